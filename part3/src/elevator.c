@@ -8,6 +8,10 @@
 #include <linux/delay.h>
 #include <linux/string.h>
 #include <linux/uaccess.h>
+#include <linux/seq_file.h>
+#include <linux/jiffies.h>
+#include <linux/types.h>
+#include <linux/mm.h>
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Group 30");
@@ -19,7 +23,9 @@ extern int (*STUB_issue_request)(int, int, int);
 extern int (*STUB_stop_elevator)(void);
 
 #define ENTRY_NAME "elevator"
+#define STATE_ENTRY_NAME "elevator_state"
 #define PERMS 0644
+#define STATE_PERMS 0600
 #define PARENT NULL
 #define MAX_FLOORS 6
 #define MAX_WEIGHT 750
@@ -27,6 +33,10 @@ extern int (*STUB_stop_elevator)(void);
 #define SOPHOMORE_WEIGHT 150
 #define JUNIOR_WEIGHT 200
 #define SENIOR_WEIGHT 250
+#define MAX_PASSENGERS 5
+#define STATE_MAGIC 0x31564c45  // "ELV1"
+#define STATE_VERSION 1
+#define STATE_MAX_SIZE (1 << 20)
 
 // States enum
 enum elevator_state {
@@ -50,6 +60,7 @@ struct passenger {
     enum passenger_type type;
     int start_floor;
     int dest_floor;
+    u64 enqueued;  // jiffies when the request was issued
     struct list_head list;
 };
 
@@ -70,12 +81,38 @@ struct elevator {
     bool running;
 };
 
+// Checkpoint blob layout: header, then cabin records, then the records of
+// floors 1..MAX_FLOORS, each list in queue order. Native endianness; the
+// timestamps are jiffies, so a blob is only meaningful within one boot.
+struct state_header {
+    u32 magic;
+    u16 version;
+    u16 max_floors;
+    u32 state;
+    u32 current_floor;
+    u32 total_serviced;
+    u32 cabin_count;
+    u32 waiting_count[MAX_FLOORS];
+} __packed;
+
+struct state_record {
+    u64 enqueued;
+    u8 type;
+    u8 start_floor;
+    u8 dest_floor;
+    u8 pad;
+} __packed;
+
 // Global variables
 static struct proc_dir_entry* elevator_entry;
 static struct elevator* elevator;
 static struct floor* floors;
 static struct task_struct* elevator_thread;
 static DEFINE_MUTEX(elevator_mutex);
+static struct proc_dir_entry* state_entry;
+static bool state_imported;
+static bool started;  // start_elevator has succeeded at least once
+static bool frozen;   // state was exported; nothing may change until unload
 
 // Helper Functions
 static const char* get_state_string(enum elevator_state state) {
@@ -108,6 +145,11 @@ static int start_elevator(void) {
         return -ENOMEM;  // Memory allocation failed
     }
     
+    if (frozen) {
+        mutex_unlock(&elevator_mutex);
+        return -EBUSY;  // State was exported for an upgrade
+    }
+    
     if (elevator->state != OFFLINE) {
         mutex_unlock(&elevator_mutex);
         return 1;  // Return 1 if elevator is already active
@@ -119,6 +161,7 @@ static int start_elevator(void) {
     elevator->current_floor = 1;
     elevator->passenger_count = 0;
     // Don't reset total_serviced
+    started = true;
     
     wake_up_process(elevator_thread);
     mutex_unlock(&elevator_mutex);
@@ -133,6 +176,11 @@ static int stop_elevator(void) {
         return -ENOMEM;
     }
     
+    if (frozen) {
+        mutex_unlock(&elevator_mutex);
+        return -EBUSY;
+    }
+    
     if (elevator->state == OFFLINE) {
         mutex_unlock(&elevator_mutex);
         return 0;  // Already offline
@@ -177,9 +225,15 @@ static int add_passenger(int type, int start_floor, int dest_floor) {
     p->type = p_type;
     p->start_floor = start_floor;
     p->dest_floor = dest_floor;
+    p->enqueued = get_jiffies_64();
     INIT_LIST_HEAD(&p->list);
 
     mutex_lock(&elevator_mutex);
+    if (frozen) {
+        mutex_unlock(&elevator_mutex);
+        kfree(p);
+        return -EBUSY;  // Would be lost when the module is replaced
+    }
     list_add_tail(&p->list, &floors[start_floor-1].passengers);
     floors[start_floor-1].waiting_count++;
     mutex_unlock(&elevator_mutex);
@@ -195,7 +249,7 @@ static int elevator_run(void* data) {
     while (!kthread_should_stop()) {
         mutex_lock(&elevator_mutex);
 
-        if (!elevator->running || elevator->state == OFFLINE) {
+        if (frozen || !elevator->running || elevator->state == OFFLINE) {
             mutex_unlock(&elevator_mutex);
             msleep(100);
             continue;
@@ -216,7 +270,7 @@ static int elevator_run(void* data) {
                 }
 
                 // Second priority: Check if we can load at current floor
-                if (!should_load && elevator->passenger_count < 5 && 
+                if (!should_load && elevator->passenger_count < MAX_PASSENGERS && 
                     !list_empty(&floors[elevator->current_floor-1].passengers)) {
                     
                     struct passenger *first_waiting = list_first_entry_or_null(
@@ -293,7 +347,7 @@ static int elevator_run(void* data) {
                 }
 
                 // Then try loading new passengers
-                while (elevator->passenger_count < 5 && 
+                while (elevator->passenger_count < MAX_PASSENGERS && 
                        !list_empty(&floors[elevator->current_floor-1].passengers)) {
                     
                     struct passenger *next_passenger = list_first_entry_or_null(
@@ -321,6 +375,8 @@ static int elevator_run(void* data) {
                     mutex_unlock(&elevator_mutex);
                     msleep(1000);  // Loading/unloading time
                     mutex_lock(&elevator_mutex);
+                    if (frozen)
+                        break;  // Keep the exported LOADING state
                 }
 
                 elevator->state = IDLE;  // Always return to IDLE to reassess situation
@@ -332,6 +388,8 @@ static int elevator_run(void* data) {
                     mutex_unlock(&elevator_mutex);
                     msleep(2000);  // Moving time
                     mutex_lock(&elevator_mutex);
+                    if (frozen)
+                        break;  // The new module redoes the move
                     
                     elevator->current_floor++;
                     elevator->state = IDLE;  // Reassess at new floor
@@ -346,6 +404,8 @@ static int elevator_run(void* data) {
                     mutex_unlock(&elevator_mutex);
                     msleep(2000);  // Moving time
                     mutex_lock(&elevator_mutex);
+                    if (frozen)
+                        break;  // The new module redoes the move
                     
                     elevator->current_floor--;
                     elevator->state = IDLE;  // Reassess at new floor
@@ -488,12 +548,225 @@ static int elevator_issue_request(int start_floor, int dest_floor, int type) {
     return 0;  // Return 0 for successful request
 }
 
+static void free_passenger_list(struct list_head* head) {
+    struct passenger *p, *temp;
+
+    list_for_each_entry_safe(p, temp, head, list) {
+        list_del(&p->list);
+        kfree(p);
+    }
+}
+
+// Checkpoint/restore for module upgrades: reading /proc/elevator_state
+// yields a binary snapshot, writing it to a freshly loaded module restores it
+static void state_write_record(struct seq_file* m, struct passenger* p) {
+    struct state_record rec = {
+        .enqueued = p->enqueued,
+        .type = p->type,
+        .start_floor = p->start_floor,
+        .dest_floor = p->dest_floor,
+    };
+
+    seq_write(m, &rec, sizeof(rec));
+}
+
+static int state_show(struct seq_file* m, void* v) {
+    struct state_header hdr = {
+        .magic = STATE_MAGIC,
+        .version = STATE_VERSION,
+        .max_floors = MAX_FLOORS,
+    };
+    struct passenger* p;
+    size_t records;
+    int i;
+
+    // seq_file re-runs this with a larger buffer on overflow, so each
+    // attempt must emit a complete snapshot taken under a single lock
+    mutex_lock(&elevator_mutex);
+
+    hdr.state = elevator->state;
+    hdr.current_floor = elevator->current_floor;
+    hdr.total_serviced = elevator->total_serviced;
+    hdr.cabin_count = elevator->passenger_count;
+    records = hdr.cabin_count;
+    for (i = 0; i < MAX_FLOORS; i++) {
+        hdr.waiting_count[i] = floors[i].waiting_count;
+        records += hdr.waiting_count[i];
+    }
+
+    // Refuse here rather than produce a blob the importer will reject
+    if (sizeof(hdr) + records * sizeof(struct state_record) > STATE_MAX_SIZE) {
+        mutex_unlock(&elevator_mutex);
+        return -EFBIG;
+    }
+
+    // From here on the snapshot is authoritative: the thread stops moving
+    // and new requests are refused until the module is unloaded
+    frozen = true;
+
+    seq_write(m, &hdr, sizeof(hdr));
+
+    list_for_each_entry(p, &elevator->passengers, list) {
+        state_write_record(m, p);
+    }
+    for (i = 0; i < MAX_FLOORS; i++) {
+        list_for_each_entry(p, &floors[i].passengers, list) {
+            state_write_record(m, p);
+        }
+    }
+
+    mutex_unlock(&elevator_mutex);
+    return 0;
+}
+
+// Rebuild one list from the blob; floor is 0 for the cabin, whose weight
+// is summed into *weight
+static int state_load_list(const struct state_record** rec, u32 n, int floor,
+                           struct list_head* dst, int* weight) {
+    struct passenger* p;
+    u32 i;
+
+    for (i = 0; i < n; i++, (*rec)++) {
+        const struct state_record* r = *rec;
+        int w = get_passenger_weight(r->type);
+
+        if (!w ||
+            r->start_floor < 1 || r->start_floor > MAX_FLOORS ||
+            r->dest_floor < 1 || r->dest_floor > MAX_FLOORS ||
+            r->start_floor == r->dest_floor ||
+            (floor && r->start_floor != floor)) {
+            return -EINVAL;
+        }
+
+        p = kmalloc(sizeof(*p), GFP_KERNEL);
+        if (!p) return -ENOMEM;
+
+        p->type = r->type;
+        p->start_floor = r->start_floor;
+        p->dest_floor = r->dest_floor;
+        p->enqueued = r->enqueued;
+        list_add_tail(&p->list, dst);
+        if (weight)
+            *weight += w;
+    }
+
+    return 0;
+}
+
+static ssize_t state_write(struct file* file, const char __user* ubuf, size_t count, loff_t* ppos) {
+    const struct state_header* hdr;
+    const struct state_record* rec;
+    struct list_head cabin;
+    struct list_head queued[MAX_FLOORS];
+    size_t records, expected;
+    int cabin_weight = 0;
+    char* buf;
+    ssize_t ret;
+    int i;
+
+    // The whole blob must arrive in a single write
+    if (count < sizeof(*hdr) || count > STATE_MAX_SIZE)
+        return -EINVAL;
+
+    buf = vmemdup_user(ubuf, count);
+    if (IS_ERR(buf))
+        return PTR_ERR(buf);
+
+    hdr = (const struct state_header*)buf;
+    rec = (const struct state_record*)(buf + sizeof(*hdr));
+    records = (count - sizeof(*hdr)) / sizeof(*rec);
+
+    INIT_LIST_HEAD(&cabin);
+    for (i = 0; i < MAX_FLOORS; i++)
+        INIT_LIST_HEAD(&queued[i]);
+
+    ret = -EINVAL;
+    if (hdr->magic != STATE_MAGIC || hdr->version != STATE_VERSION ||
+        hdr->max_floors != MAX_FLOORS || hdr->state > DOWN ||
+        hdr->current_floor < 1 || hdr->current_floor > MAX_FLOORS ||
+        hdr->cabin_count > MAX_PASSENGERS ||
+        (hdr->state == OFFLINE && hdr->cabin_count > 0)) {
+        goto out_free;
+    }
+
+    expected = hdr->cabin_count;
+    for (i = 0; i < MAX_FLOORS; i++) {
+        if (hdr->waiting_count[i] > records)
+            goto out_free;
+        expected += hdr->waiting_count[i];
+    }
+    if (expected != records || count != sizeof(*hdr) + records * sizeof(*rec))
+        goto out_free;
+
+    ret = state_load_list(&rec, hdr->cabin_count, 0, &cabin, &cabin_weight);
+    for (i = 0; !ret && i < MAX_FLOORS; i++)
+        ret = state_load_list(&rec, hdr->waiting_count[i], i + 1, &queued[i], NULL);
+    if (ret)
+        goto out_free_lists;
+
+    if (cabin_weight > MAX_WEIGHT) {
+        ret = -EINVAL;
+        goto out_free_lists;
+    }
+
+    mutex_lock(&elevator_mutex);
+
+    // Only a module that has never been started or exported may take over
+    if (state_imported || started || frozen) {
+        mutex_unlock(&elevator_mutex);
+        ret = -EBUSY;
+        goto out_free_lists;
+    }
+
+    list_splice_tail_init(&cabin, &elevator->passengers);
+    elevator->passenger_count = hdr->cabin_count;
+    elevator->current_weight = cabin_weight;
+
+    // Restored passengers were queued first, so they go ahead of any
+    // requests issued since this module was loaded
+    for (i = 0; i < MAX_FLOORS; i++) {
+        list_splice_init(&queued[i], &floors[i].passengers);
+        floors[i].waiting_count += hdr->waiting_count[i];
+    }
+
+    elevator->current_floor = hdr->current_floor;
+    elevator->total_serviced += hdr->total_serviced;
+    elevator->state = hdr->state;
+    elevator->running = (hdr->state != OFFLINE);
+    state_imported = true;
+
+    mutex_unlock(&elevator_mutex);
+
+    kvfree(buf);
+    return count;
+
+out_free_lists:
+    free_passenger_list(&cabin);
+    for (i = 0; i < MAX_FLOORS; i++)
+        free_passenger_list(&queued[i]);
+out_free:
+    kvfree(buf);
+    return ret;
+}
+
+static int state_open(struct inode* inode, struct file* file) {
+    return single_open(file, state_show, NULL);
+}
+
 
 static const struct proc_ops elevator_fops = {
     .proc_read = elevator_read,
     .proc_write = elevator_write,
 };
 
+static const struct proc_ops state_fops = {
+    .proc_open = state_open,
+    .proc_read = seq_read,
+    .proc_lseek = seq_lseek,
+    .proc_release = single_release,
+    .proc_write = state_write,
+};
+
 
 // Module init
 static int __init elevator_init(void) {
@@ -540,6 +813,16 @@ static int __init elevator_init(void) {
         return PTR_ERR(elevator_thread);
     }
 
+    // Created last so imports never see half-initialised state
+    state_entry = proc_create(STATE_ENTRY_NAME, STATE_PERMS, PARENT, &state_fops);
+    if (!state_entry) {
+        kthread_stop(elevator_thread);
+        kfree(floors);
+        kfree(elevator);
+        proc_remove(elevator_entry);
+        return -ENOMEM;
+    }
+
     // Connect syscall stubs
     STUB_start_elevator = start_elevator;
     STUB_issue_request = elevator_issue_request;
@@ -552,7 +835,6 @@ static int __init elevator_init(void) {
 // Module cleanup
 static void __exit elevator_exit(void) {
     int i;
-    struct passenger *p, *temp;
 
     // Disconnect syscall stubs
     STUB_start_elevator = NULL;
@@ -561,19 +843,15 @@ static void __exit elevator_exit(void) {
 
     kthread_stop(elevator_thread);
 
+    // Remove the state entry first so no import races the teardown
+    proc_remove(state_entry);
+
     // Free elevator passengers
-    list_for_each_entry_safe(p, temp, &elevator->passengers, list) {
-        list_del(&p->list);
-        kfree(p);
-    }
+    free_passenger_list(&elevator->passengers);
 
     // Free waiting passengers
-    for (i = 0; i < MAX_FLOORS; i++) {
-        list_for_each_entry_safe(p, temp, &floors[i].passengers, list) {
-            list_del(&p->list);
-            kfree(p);
-        }
-    }
+    for (i = 0; i < MAX_FLOORS; i++)
+        free_passenger_list(&floors[i].passengers);
 
     kfree(floors);
     kfree(elevator);